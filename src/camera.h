@@ -4,6 +4,11 @@
 #include "raytracer.h"
 #include "hittable.h"
 #include "material.h"
+#include "guiding.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
 
 class camera {
     public:
@@ -20,35 +25,112 @@ class camera {
         double defocus_angle        = 0;
         double focus_dist           = 10;
 
+        // Optional path guiding: the first sample passes train the cache, the
+        // remaining ones sample from it. Training ends after
+        // guiding_training_passes, or with a time budget after
+        // guiding_training_fraction of it, whichever comes first.
+        shared_ptr<guiding_cache> guiding;
+        int     guiding_training_passes   = 8;
+        double  guiding_training_fraction = 0.25;
+
+        // Region of interest in pixels of the full image; width and height both 0
+        // render the whole frame. The window is clipped to the image, and one that
+        // misses it (or has a negative size) renders nothing. The output image
+        // (and the written PPM) is only the cropped region.
+        int     crop_x      = 0;
+        int     crop_y      = 0;
+        int     crop_width  = 0;
+        int     crop_height = 0;
+
+        bool    show_progress = true;
+
         void render(const hittable &world)
         {
-            initialize();
+            auto image = render_image(world);
 
             std::cout << "P3\n"
-                      << image_width << ' ' << image_height << "\n255\n";
+                      << region_width << ' ' << region_height << "\n255\n";
+            for (const auto &pixel_color : image)
+                write_color(std::cout, pixel_color);
+        }
+
+        // Renders one sample per pixel per pass, stopping after samples_per_pixel
+        // passes or once time_budget seconds have elapsed (checked between passes,
+        // at least one pass always runs). Returns the averaged linear colors, row major.
+        std::vector<color> render_image(const hittable &world, double time_budget = infinity)
+        {
+            initialize();
+
+            passes_rendered = 0;
+            guided_passes = 0;
+            if (region_width == 0 || region_height == 0)
+            {
+                std::clog << "Crop window (" << crop_x << ',' << crop_y << ' ' << crop_width << 'x' << crop_height
+                          << ") does not overlap the " << image_width << 'x' << image_height << " image.\n";
+                return {};
+            }
+
+            std::vector<color> accum(std::size_t(region_width) * region_height, color(0, 0, 0));
+            auto start = std::chrono::steady_clock::now();
 
-            for (int i = 0; i < image_height; i++)
+            active_guide = nullptr;
+            while (passes_rendered < samples_per_pixel)
             {
-                std::clog << "\rScanlines remaining: " << (image_height - i) << ' ' << std::flush;
-                for (int j = 0; j < image_width; j++)
+                if (show_progress)
+                    std::clog << "\rSample passes remaining: " << (samples_per_pixel - passes_rendered) << ' ' << std::flush;
+
+                if (guiding && !active_guide)
                 {
-                    color pixel_color(0, 0, 0);
-                    // send multiple rays from a single pixel 
-                    for (int sample = 0; sample < samples_per_pixel;sample++)
+                    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                    if (passes_rendered >= guiding_training_passes ||
+                        elapsed.count() >= guiding_training_fraction * time_budget)
                     {
-                        ray r = get_ray(i, j);   //indicate coordinate
-                        pixel_color += ray_color(r, max_depth, world);
+                        guiding->update();
+                        active_guide = guiding.get();
                     }
-                    write_color(std::cout, pixel_samples_scale * pixel_color);  // take average
                 }
+                if (active_guide)
+                    guided_passes++;
+
+                for (int i = 0; i < region_height; i++)
+                {
+                    for (int j = 0; j < region_width; j++)
+                    {
+                        ray r = get_ray(region_y + i, region_x + j);   //indicate coordinate
+                        accum[std::size_t(i) * region_width + j] += ray_color(r, max_depth, world, 0, pixel_spread);
+                    }
+                }
+                passes_rendered++;
+
+                std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                if (elapsed.count() >= time_budget)
+                    break;
             }
-            std::clog << "\rDone.                 \n";
+            active_guide = nullptr;
+            if (show_progress)
+                std::clog << "\rDone.                        \n";
+
+            for (auto &pixel_color : accum)
+                pixel_color /= passes_rendered;  // take average
+            return accum;
         }
 
+        int rendered_samples_per_pixel() const { return passes_rendered; }
+
+        // how many of those passes sampled from the guiding cache
+        int guided_samples_per_pixel() const { return guided_passes; }
+
+        // size of the image returned by the last render_image() call
+        int rendered_width() const { return region_width; }
+        int rendered_height() const { return region_height; }
+
 
     private:
         int         image_height;
-        double      pixel_samples_scale;
+        int         passes_rendered = 0;
+        int         guided_passes = 0;
+        int         region_x, region_y, region_width, region_height;  // crop clamped to the image
+        const guiding_cache* active_guide = nullptr;  // non-null while passes sample from the guiding cache
         point3D     center;
         point3D     pixel00_loc;
         vec3        pixel_delta_u;
@@ -56,12 +138,23 @@ class camera {
         vec3        u, v, w;
         vec3        focus_disk_u;
         vec3        focus_disk_v;
+        double      pixel_spread;  // angle subtended by one pixel, grows the ray cone used for mip selection
 
         void initialize(){
             image_height = int(image_width / aspect_ratio);
             image_height = (image_height < 1) ? 1 : image_height;
 
-            pixel_samples_scale = 1.0 / samples_per_pixel;
+            region_x = 0;
+            region_y = 0;
+            region_width = image_width;
+            region_height = image_height;
+            if (crop_width != 0 || crop_height != 0)
+            {
+                region_x = std::max(0, crop_x);
+                region_y = std::max(0, crop_y);
+                region_width = std::max(0, std::min(crop_x + crop_width, image_width) - region_x);
+                region_height = std::max(0, std::min(crop_y + crop_height, image_height) - region_y);
+            }
 
             center = lookfrom;
 
@@ -79,6 +172,7 @@ class camera {
 
             pixel_delta_u = viewport_u / image_width;
             pixel_delta_v = viewport_v / image_height;
+            pixel_spread = pixel_delta_u.length() / focus_dist;
 
             auto viewport_upper_left = center - (focus_dist * w) - viewport_u / 2 - viewport_v / 2;
             pixel00_loc = viewport_upper_left + 0.5 * (pixel_delta_u + pixel_delta_v);
@@ -102,7 +196,9 @@ class camera {
             return vec3(random_double() - 0.5, random_double() - 0.5, 0);
         }
 
-        color ray_color(const ray &r, int depth ,const hittable &world) const
+        // Ray cone for mip selection: cone_width is the world-space width of the
+        // pixel footprint at the ray origin, cone_spread how fast it grows per unit distance.
+        color ray_color(const ray &r, int depth ,const hittable &world, double cone_width, double cone_spread) const
         {
             if(depth <= 0)
                 return color(0, 0, 0);
@@ -111,8 +207,16 @@ class camera {
             {
                 ray scattered;
                 color attenuation;
+                cone_width += cone_spread * rec.t * r.direction().length();
+                rec.uv_width = cone_width * rec.uv_scale;
+                rec.guide = active_guide;
                 if(rec.mat->scatter(r,rec,attenuation,scattered)){
-                    return attenuation * ray_color(scattered,depth - 1,world);
+                    color contribution = attenuation * ray_color(scattered,depth - 1,world,cone_width,
+                                                                          cone_spread + rec.mat->scatter_spread());
+                    // only training passes record; they are the ones sampling without the cache
+                    if (guiding && !active_guide && rec.mat->guidable())
+                        guiding->record(rec.p, unit_vector(scattered.direction()), contribution);
+                    return contribution;
                 }
                 return color(0, 0, 0); // if ray is not scattered, in this ocassion that means the light has been absorbed. so color is black
                 // situation might change accordingly.
@@ -0,0 +1,264 @@
+#ifndef GUIDING_H
+#define GUIDING_H
+
+#include "raytracer.h"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Learned directional distributions for guiding diffuse bounces.
+//
+// Space is cut into a hashed grid of cells; each cell keeps a histogram over
+// all directions (equal-area cylindrical mapping: cos(theta) x phi, so every
+// bin covers the same solid angle). During training the camera feeds back the
+// light carried by each diffuse bounce, which makes a cell's histogram
+// approximate incoming radiance times the cosine term. The bins and cells are
+// deliberately coarse: every record is a single noisy path, and a histogram
+// with few records per bin guides worse than plain cosine sampling.
+//
+// Cells live in a fixed-size open-addressed table claimed with atomics, so
+// record() never locks and can run from any number of render threads, also
+// alongside sample(). update() turns the histograms into sampling
+// distributions and must run between passes, while nobody samples.
+class guiding_cache
+{
+public:
+    static const int theta_bins = 4;
+    static const int phi_bins = 8;
+    static const int bins = theta_bins * phi_bins;
+
+    double cell_size;           // world-space edge length of a grid cell
+    double guide_probability;   // chance of sampling the learned distribution instead of the cosine lobe
+    double min_records_per_bin; // average records per bin a cell needs before it is used for sampling
+
+    // max_cells is rounded up to a power of two; every cell costs about 0.1 KiB
+    // of histogram and 0.1 KiB of distribution. Records for cells that find no
+    // free slot are dropped.
+    guiding_cache(double cell_size = 1.0, double guide_probability = 0.5, double min_records_per_bin = 8,
+                  int max_cells = 1 << 15)
+        : cell_size(cell_size), guide_probability(guide_probability), min_records_per_bin(min_records_per_bin),
+          cells(round_up_pow2(max_cells)), distributions(cells.size()), ready(cells.size(), 0) {}
+
+    // Accumulate one diffuse bounce: light arriving at p from direction dir
+    // (unit length, pointing away from p), already weighted by the bounce.
+    void record(const point3D &p, const vec3 &dir, const color &contribution)
+    {
+        double value = 0.2126 * contribution.x() + 0.7152 * contribution.y() + 0.0722 * contribution.z();
+        if (!(value >= 0) || value == infinity)
+            return;
+
+        int slot = claim_slot(cell_key(p));
+        if (slot < 0)
+            return;
+        cell &c = cells[slot];
+        atomic_add(c.weights[direction_to_bin(dir)], float(value));
+        c.records.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Rebuild the sampling distributions from everything recorded so far. The
+    // readiness threshold is per bin, so it asks for the same histogram quality
+    // whatever the resolution or training time that produced the records.
+    void update()
+    {
+        const double min_records = min_records_per_bin * bins;
+        ready_cells = 0;
+        for (std::size_t slot = 0; slot < cells.size(); slot++)
+        {
+            const cell &c = cells[slot];
+            ready[slot] = 0;
+            if (c.key.load(std::memory_order_acquire) == 0 ||
+                c.records.load(std::memory_order_relaxed) < min_records)
+                continue;
+
+            distribution &d = distributions[slot];
+            double sum = 0;
+            for (int i = 0; i < bins; i++)
+            {
+                sum += c.weights[i].load(std::memory_order_relaxed);
+                d.cdf[i] = float(sum);
+            }
+            if (sum <= 0)
+                continue;
+            for (int i = 0; i < bins; i++)
+                d.cdf[i] = float(d.cdf[i] / sum);
+            d.cdf[bins - 1] = 1.0f;
+            ready[slot] = 1;
+            ready_cells++;
+        }
+    }
+
+    // Sample a diffuse bounce direction at p from the mixture of the learned
+    // distribution and the cosine lobe around normal. On success, direction is
+    // set and weight is (cos / pi) / mixture_pdf, the factor that replaces the
+    // implicit 1 of plain cosine sampling. Returns false if p has no usable
+    // distribution, in which case the caller samples as usual.
+    bool sample(const point3D &p, const vec3 &normal, vec3 &direction, double &weight) const
+    {
+        int slot = find_slot(cell_key(p));
+        if (slot < 0 || !ready[slot])
+            return false;
+        const distribution &d = distributions[slot];
+
+        if (random_double() < guide_probability)
+        {
+            direction = d.sample_direction();
+        }
+        else
+        {
+            direction = normal + random_unit_vector();
+            if (direction.near_zero())
+                direction = normal;
+            direction = unit_vector(direction);
+        }
+
+        double cosine = dot(direction, normal);
+        if (cosine <= 0)
+        {
+            weight = 0; // learned lobe pointed below the surface
+            return true;
+        }
+        double cosine_pdf = cosine / pi;
+        double mixture_pdf = guide_probability * d.pdf(direction) + (1 - guide_probability) * cosine_pdf;
+        weight = cosine_pdf / mixture_pdf;
+        return true;
+    }
+
+    std::size_t cell_count() const { return used_cells.load(std::memory_order_relaxed); }
+    std::size_t ready_cell_count() const { return ready_cells; }
+
+    void report(std::ostream &out) const
+    {
+        out << "Guiding cache: " << cell_count() << " of " << cells.size() << " cells used, "
+            << ready_cells << " with sampling distributions (" << min_records_per_bin * bins << "+ records)\n";
+    }
+
+private:
+    struct cell
+    {
+        std::atomic<std::uint64_t> key{0};  // cell_key + 1, 0 while the slot is free
+        std::atomic<float> weights[bins];
+        std::atomic<int> records{0};
+
+        cell()
+        {
+            for (auto &w : weights)
+                w.store(0.0f, std::memory_order_relaxed);
+        }
+    };
+
+    struct distribution
+    {
+        float cdf[bins];
+
+        vec3 sample_direction() const
+        {
+            double xi = random_double();
+            int lo = 0, hi = bins - 1;
+            while (lo < hi) // first bin whose cdf exceeds xi
+            {
+                int mid = (lo + hi) / 2;
+                if (cdf[mid] > xi)
+                    hi = mid;
+                else
+                    lo = mid + 1;
+            }
+            int t = lo / phi_bins, f = lo % phi_bins;
+            double cos_theta = -1 + 2 * (t + random_double()) / theta_bins;
+            double phi = 2 * pi * (f + random_double()) / phi_bins;
+            double sin_theta = std::sqrt(std::fmax(0.0, 1 - cos_theta * cos_theta));
+            return vec3(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta);
+        }
+
+        double pdf(const vec3 &dir) const
+        {
+            int b = direction_to_bin(dir);
+            double mass = cdf[b] - (b > 0 ? cdf[b - 1] : 0.0f);
+            return mass * bins / (4 * pi); // every bin spans 4pi/bins steradians
+        }
+    };
+
+    static const int max_probes = 16;
+
+    std::vector<cell> cells;
+    std::vector<distribution> distributions;  // parallel to cells, rebuilt by update()
+    std::vector<char> ready;
+    std::atomic<std::size_t> used_cells{0};
+    std::size_t ready_cells = 0;
+
+    static std::size_t round_up_pow2(int n)
+    {
+        std::size_t capacity = 1;
+        while (capacity < std::size_t(n))
+            capacity *= 2;
+        return capacity;
+    }
+
+    static int direction_to_bin(const vec3 &dir)
+    {
+        double cos_theta = interval(-1, 1).clamp(dir.z());
+        double phi = std::atan2(dir.y(), dir.x());
+        if (phi < 0)
+            phi += 2 * pi;
+        int t = std::min(int((cos_theta + 1) / 2 * theta_bins), theta_bins - 1);
+        int f = std::min(int(phi / (2 * pi) * phi_bins), phi_bins - 1);
+        return t * phi_bins + f;
+    }
+
+    std::uint64_t cell_key(const point3D &p) const
+    {
+        // 21 bits per axis, wrapping; far-apart cells may share a key, which only blurs guiding
+        auto q = [this](double x) { return std::uint64_t(std::int64_t(std::floor(x / cell_size))) & 0x1fffff; };
+        return (q(p.x()) << 42) | (q(p.y()) << 21) | q(p.z());
+    }
+
+    std::size_t home_slot(std::uint64_t key) const
+    {
+        return std::size_t((key * 0x9E3779B97F4A7C15ull) >> 20) & (cells.size() - 1);
+    }
+
+    // Linear probing from the key's hash; -1 if the cell was never recorded.
+    int find_slot(std::uint64_t key) const
+    {
+        const std::uint64_t stored = key + 1;
+        std::size_t slot = home_slot(key);
+        for (int probe = 0; probe < max_probes; probe++, slot = (slot + 1) & (cells.size() - 1))
+        {
+            std::uint64_t current = cells[slot].key.load(std::memory_order_acquire);
+            if (current == stored)
+                return int(slot);
+            if (current == 0)
+                return -1;
+        }
+        return -1;
+    }
+
+    // Like find_slot(), but claims the first free slot; -1 if the probe run is full.
+    int claim_slot(std::uint64_t key)
+    {
+        const std::uint64_t stored = key + 1;
+        std::size_t slot = home_slot(key);
+        for (int probe = 0; probe < max_probes; probe++, slot = (slot + 1) & (cells.size() - 1))
+        {
+            std::uint64_t current = cells[slot].key.load(std::memory_order_acquire);
+            if (current == 0 && cells[slot].key.compare_exchange_strong(current, stored, std::memory_order_acq_rel))
+            {
+                used_cells.fetch_add(1, std::memory_order_relaxed);
+                return int(slot);
+            }
+            if (current == stored) // ours, possibly just claimed by another thread
+                return int(slot);
+        }
+        return -1;
+    }
+
+    static void atomic_add(std::atomic<float> &target, float value)
+    {
+        float old = target.load(std::memory_order_relaxed);
+        while (!target.compare_exchange_weak(old, old + value, std::memory_order_relaxed))
+        {
+        }
+    }
+};
+
+#endif
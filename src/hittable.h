@@ -4,13 +4,19 @@
 #include "raytracer.h"
 
 class material;
+class guiding_cache;
 class hit_record{
     public:
         point3D p;
         vec3 normal;
         double t;
+        double u;
+        double v;
+        double uv_scale = 0;    // texture-space units per world unit around p
+        double uv_width = 0;    // pixel footprint in texture space, filled in by the camera
         shared_ptr<material> mat;
         bool front_face;
+        const guiding_cache* guide = nullptr;  // set by the camera once guided sampling is enabled
 
         void set_face_normal(const ray& r, const vec3& outward_normal)
         {
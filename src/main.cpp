@@ -4,12 +4,24 @@
 #include "hittable_list.h"
 #include "material.h"
 #include "sphere.h"
+#include "guiding.h"
+#include "preview.h"
+#include "texture.h"
+#include "texture_cache.h"
 
-int main()
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+// With a texture cache, the ground becomes a checker and the large diffuse
+// sphere is wrapped in image_file, streamed through the cache.
+hittable_list random_spheres_scene(shared_ptr<texture_cache> textures = nullptr, const std::string &image_file = "")
 {
     hittable_list world;
 
-    auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    auto ground_material = textures
+        ? make_shared<lambertian>(make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9)))
+        : make_shared<lambertian>(color(0.5, 0.5, 0.5));
     world.add(make_shared<sphere>(point3D(0, -1000, 0), 1000, ground_material));
 
     for (int a = -11; a < 11; a++)
@@ -51,12 +63,19 @@ int main()
     auto material1 = make_shared<dielectric>(1.5);
     world.add(make_shared<sphere>(point3D(0, 1, 0), 1.0, material1));
 
-    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
+    auto material2 = textures
+        ? make_shared<lambertian>(make_shared<image_texture>(image_file, textures))
+        : make_shared<lambertian>(color(0.4, 0.2, 0.1));
     world.add(make_shared<sphere>(point3D(-4, 1, 0), 1.0, material2));
 
     auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
     world.add(make_shared<sphere>(point3D(4, 1, 0), 1.0, material3));
 
+    return world;
+}
+
+camera scene_camera()
+{
     camera cam;
 
     cam.aspect_ratio = 16.0 / 9.0;
@@ -72,5 +91,278 @@ int main()
     cam.defocus_angle = 0.6;
     cam.focus_dist = 10.0;
 
+    return cam;
+}
+
+// Diffuse spheres between a ground and a ceiling 1.5 units above it: the sky is
+// only visible in a thin band at the horizon, so indirect light dominates.
+hittable_list covered_scene()
+{
+    hittable_list world;
+
+    auto grey = make_shared<lambertian>(color(0.7, 0.7, 0.7));
+    world.add(make_shared<sphere>(point3D(0, -1000, 0), 1000, grey));
+    world.add(make_shared<sphere>(point3D(0, 1001.5, 0), 1000, grey));
+
+    for (int a = -4; a < 4; a++)
+    {
+        for (int b = -4; b < 4; b++)
+        {
+            point3D center(a * 1.3 + 0.3 * random_double(), 0.4, b * 1.3);
+            world.add(make_shared<sphere>(center, 0.4, make_shared<lambertian>(color::random(0.3, 0.9))));
+        }
+    }
+
+    return world;
+}
+
+camera covered_camera()
+{
+    camera cam;
+
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 1200;
+    cam.samples_per_pixel = 500;
+    cam.max_depth = 8;
+
+    cam.vfov = 60;
+    cam.lookfrom = point3D(6, 0.8, 4);
+    cam.lookat = point3D(0, 0.5, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+    cam.focus_dist = 7.0;
+
+    return cam;
+}
+
+double rmse(const std::vector<color> &image, const std::vector<color> &reference)
+{
+    double sum = 0;
+    for (size_t i = 0; i < image.size(); i++)
+        sum += (image[i] - reference[i]).length_squared() / 3;
+    return std::sqrt(sum / image.size());
+}
+
+// Mean and sample standard deviation, printed as "mean +- spread".
+std::string mean_spread(const std::vector<double> &values)
+{
+    double mean = 0, var = 0;
+    for (double v : values)
+        mean += v / values.size();
+    for (double v : values)
+        var += (v - mean) * (v - mean) / std::max<size_t>(1, values.size() - 1);
+    std::ostringstream out;
+    out << mean << " +- " << std::sqrt(var);
+    return out.str();
+}
+
+// Equal-time comparison of the plain and the guided path tracer against a
+// high sample count reference, at a reduced resolution. Single runs at
+// these budgets differ by about as much as the two methods do, so both are
+// repeated and reported as mean and spread over the runs.
+void compare_guiding(const hittable &world, camera cam, double seconds, int reference_spp, int image_width, int runs)
+{
+    cam.image_width = image_width;
+
+    std::clog << "Reference (" << reference_spp << " spp):\n";
+    cam.samples_per_pixel = reference_spp;
+    auto reference = cam.render_image(world);
+
+    cam.samples_per_pixel = 1000000;  // bounded by time instead
+    cam.show_progress = false;
+
+    std::vector<double> plain_rmse, plain_spp, guided_rmse, guided_spp, guided_passes, ready_cells;
+    for (int run = 0; run < runs; run++)
+    {
+        cam.guiding = nullptr;
+        auto plain = cam.render_image(world, seconds);
+        plain_rmse.push_back(rmse(plain, reference));
+        plain_spp.push_back(cam.rendered_samples_per_pixel());
+
+        cam.guiding = make_shared<guiding_cache>();
+        auto guided = cam.render_image(world, seconds);
+        if (cam.guided_samples_per_pixel() == 0)
+        {
+            cam.guiding->report(std::clog);
+            std::clog << "ERROR: no pass sampled from the guiding cache within " << seconds
+                      << " s; raise the time budget or lower the resolution.\n";
+            return;
+        }
+        guided_rmse.push_back(rmse(guided, reference));
+        guided_spp.push_back(cam.rendered_samples_per_pixel());
+        guided_passes.push_back(cam.guided_samples_per_pixel());
+        ready_cells.push_back(cam.guiding->ready_cell_count());
+
+        std::clog << "run " << run + 1 << " of " << runs << ": plain " << plain_spp.back() << " spp, RMSE "
+                  << plain_rmse.back() << "; guided " << guided_spp.back() << " spp (" << guided_passes.back()
+                  << " guided), RMSE " << guided_rmse.back() << '\n';
+        if (run == runs - 1)
+            cam.guiding->report(std::clog);
+    }
+
+    std::clog << "over " << runs << " runs of " << seconds << " s each (mean +- standard deviation):\n"
+              << "plain:  " << mean_spread(plain_spp) << " spp, RMSE " << mean_spread(plain_rmse) << '\n'
+              << "guided: " << mean_spread(guided_spp) << " spp (" << mean_spread(guided_passes)
+              << " guided), RMSE " << mean_spread(guided_rmse) << ", " << mean_spread(ready_cells)
+              << " cells with distributions\n";
+}
+
+// Interactive preview: reads one command per line from stdin and rewrites
+// preview.ppm after every refinement pass.
+//   vfov <deg> | lookfrom <x y z> | lookat <x y z> | defocus_angle <deg> | focus_dist <d>
+//   scale <n>            full frame at 1/n resolution
+//   crop <x y w h>       region of the final image at full resolution
+//   refine [passes]      spend passes * seconds refining (default 1)
+//   quit
+// A line that does not parse completely prints its usage and changes nothing.
+void run_preview(const hittable &world, double seconds)
+{
+    preview pv(world, scene_camera());
+    pv.max_spp = pv.settings.samples_per_pixel;
+    pv.set_scale(4);
+
+    std::string line;
+    while (std::clog << "preview> " << std::flush, std::getline(std::cin, line))
+    {
+        std::istringstream in(line);
+        std::string cmd;
+        if (!(in >> cmd))
+            continue;
+
+        // a parameter only changes once its whole line parsed, so a typo never leaves a half-edited camera
+        auto has_argument = [&in] { return !in.eof() && !(in >> std::ws).eof(); };
+        auto line_done = [&in, &has_argument] { return !in.fail() && !has_argument(); };
+        auto usage = [&cmd](const char *args) { std::clog << "usage: " << cmd << ' ' << args << '\n'; };
+
+        camera &cam = pv.settings;
+        int refinements = 0;
+        if (cmd == "quit")
+            break;
+        else if (cmd == "vfov" || cmd == "defocus_angle" || cmd == "focus_dist")
+        {
+            double value;
+            in >> value;
+            bool ok = line_done() && (cmd == "vfov"          ? value > 0 && value < 180
+                                      : cmd == "focus_dist" ? value > 0
+                                                            : value >= 0);
+            if (!ok)
+            {
+                usage(cmd == "vfov" ? "<degrees, 0 < vfov < 180>" : cmd == "focus_dist" ? "<distance > 0>" : "<degrees >= 0>");
+                continue;
+            }
+            (cmd == "vfov" ? cam.vfov : cmd == "focus_dist" ? cam.focus_dist : cam.defocus_angle) = value;
+            pv.restart();
+            refinements = 1;
+        }
+        else if (cmd == "lookfrom" || cmd == "lookat")
+        {
+            double x, y, z;
+            in >> x >> y >> z;
+            if (!line_done())
+            {
+                usage("<x y z>");
+                continue;
+            }
+            (cmd == "lookfrom" ? cam.lookfrom : cam.lookat) = point3D(x, y, z);
+            pv.restart();
+            refinements = 1;
+        }
+        else if (cmd == "scale")
+        {
+            int n = 4;
+            if (has_argument())
+                in >> n;
+            if (!line_done() || n < 1)
+            {
+                usage("[n >= 1]");
+                continue;
+            }
+            pv.set_scale(n);
+            refinements = 1;
+        }
+        else if (cmd == "crop")
+        {
+            int x, y, w, h;
+            in >> x >> y >> w >> h;
+            if (!line_done() || !pv.set_crop(x, y, w, h))
+            {
+                std::clog << "usage: crop <x y w h>, a window with positive size inside the "
+                          << pv.frame_width() << 'x' << pv.frame_height() << " frame\n";
+                continue;
+            }
+            refinements = 1;
+        }
+        else if (cmd == "refine")
+        {
+            refinements = 1;
+            if (has_argument())
+                in >> refinements;
+            if (!line_done() || refinements < 1)
+            {
+                usage("[passes >= 1]");
+                continue;
+            }
+        }
+        else
+        {
+            std::clog << "unknown command: " << line << '\n';
+            continue;
+        }
+
+        for (int pass = 0; pass < refinements; pass++)
+        {
+            bool more = pv.refine(seconds);
+            pv.write("preview.ppm");
+            std::clog << "preview.ppm: " << pv.samples_per_pixel() << " spp\n";
+            if (!more)
+                break;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    // App --texture <image.ppm> [budget_mib] renders the textured scene and reports cache statistics
+    if (argc > 2 && std::string(argv[1]) == "--texture")
+    {
+        std::size_t budget_mib = argc > 3 ? std::size_t(std::atoi(argv[3])) : 64;
+        auto textures = make_shared<texture_cache>(budget_mib << 20);
+        hittable_list world = random_spheres_scene(textures, argv[2]);
+
+        camera cam = scene_camera();
+        cam.render(world);
+        textures->report(std::clog);
+        return 0;
+    }
+
+    hittable_list world = random_spheres_scene();
+
+    // App --compare-guiding [seconds] [reference_spp] [image_width] [covered|spheres] [runs]
+    if (argc > 1 && std::string(argv[1]) == "--compare-guiding")
+    {
+        double seconds = argc > 2 ? std::atof(argv[2]) : 10.0;
+        int reference_spp = argc > 3 ? std::atoi(argv[3]) : 1024;
+        int image_width = argc > 4 ? std::atoi(argv[4]) : 400;
+        int runs = argc > 6 ? std::max(1, std::atoi(argv[6])) : 4;
+        if (argc > 5 && std::string(argv[5]) == "spheres")
+            compare_guiding(world, scene_camera(), seconds, reference_spp, image_width, runs);
+        else
+            compare_guiding(covered_scene(), covered_camera(), seconds, reference_spp, image_width, runs);
+        return 0;
+    }
+
+    // App --preview [seconds_per_pass] < commands
+    if (argc > 1 && std::string(argv[1]) == "--preview")
+    {
+        run_preview(world, argc > 2 ? std::atof(argv[2]) : 1.0);
+        return 0;
+    }
+
+    camera cam = scene_camera();
+    // App --guiding renders the image with path guiding enabled
+    if (argc > 1 && std::string(argv[1]) == "--guiding")
+        cam.guiding = make_shared<guiding_cache>();
+
     cam.render(world);
 }
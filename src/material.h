@@ -3,6 +3,8 @@
 
 
 #include "hittable.h"  // for hit_record
+#include "texture.h"
+#include "guiding.h"
 
 class material
 {
@@ -14,12 +16,20 @@ public:
     {
         return false;
     }
+
+    // whether the camera may learn from and guide this material's bounces
+    virtual bool guidable() const { return false; }
+
+    // extra angle (radians) the camera's ray cone opens by at a bounce, so rough
+    // bounces look up coarse mip levels instead of the finest one
+    virtual double scatter_spread() const { return 0; }
 };
 
 class lambertian : public material
 {
 public:
-    lambertian(const color &albedo) : albedo(albedo) {}
+    lambertian(const color &albedo) : tex(make_shared<solid_color>(albedo)) {}
+    lambertian(shared_ptr<texture> tex) : tex(tex) {}
     // here we assume all light are being reflected
     // if only part of the light were being reflected, we need to let them to have the same effect compared to the original light
     // to achieve this we will let albedo / R, where R is the ratio of the reflected lights.
@@ -27,18 +37,33 @@ public:
     bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
         const override
     {
+        vec3 guided_direction;
+        double weight;
+        if (rec.guide && rec.guide->sample(rec.p, rec.normal, guided_direction, weight))
+        {
+            scattered = ray(rec.p, guided_direction);
+            attenuation = weight * tex->value(rec.u, rec.v, rec.p, rec.uv_width);
+            return weight > 0;  // zero when the learned lobe picked a direction below the surface
+        }
+
         auto scatter_direction = rec.normal + random_unit_vector();
         // avoid random_unit_vector() = - rec.normal
         if(scatter_direction.near_zero()){ 
             scatter_direction = rec.normal;
         }
         scattered = ray(rec.p, scatter_direction);
-        attenuation = albedo;
+        attenuation = tex->value(rec.u, rec.v, rec.p, rec.uv_width);
         return true;
     }
 
+    bool guidable() const override { return true; }
+
+    // crude: a diffuse bounce scatters over the whole hemisphere, this just keeps
+    // secondary lookups well away from the finest levels
+    double scatter_spread() const override { return 0.5; }
+
 private:
-    color albedo;  // object color
+    shared_ptr<texture> tex;  // object color
 };
 
 class metal : public material
@@ -56,6 +81,9 @@ public:
         return (dot(rec.normal,scattered.direction()) > 0);
     }
 
+    // the fuzz sphere of radius fuzz around a unit reflection opens roughly 2 * fuzz radians
+    double scatter_spread() const override { return 2 * fuzz; }
+
 private:
     color albedo; // object color
     double fuzz;
@@ -0,0 +1,128 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include "raytracer.h"
+#include "camera.h"
+#include "hittable.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Progressive preview of a resident scene. The world and the camera stay in
+// memory between passes; every refine() call spends a fixed time budget on
+// more samples and folds them into the running average, so the image keeps
+// sharpening until a camera parameter changes and restart() is called.
+//
+// Two modes: the full frame at 1/scale of the final resolution, or a crop
+// window of the final image at full resolution.
+class preview
+{
+public:
+    camera settings;   // the final render's camera; edit it, then call restart()
+    int    max_spp = 256;
+
+    preview(const hittable &world, const camera &final_camera) : settings(final_camera), world(world)
+    {
+        restart();
+    }
+
+    // Full frame at image_width / factor.
+    void set_scale(int factor)
+    {
+        scale = std::max(1, factor);
+        crop_width = crop_height = 0;
+        restart();
+    }
+
+    // Crop window in pixels of the final image, rendered at full resolution.
+    // Returns false and keeps the current mode if the window has no area or
+    // does not overlap the final frame.
+    bool set_crop(int x, int y, int width, int height)
+    {
+        if (width <= 0 || height <= 0 || x >= frame_width() || y >= frame_height() || x + width <= 0 || y + height <= 0)
+            return false;
+
+        scale = 1;
+        crop_x = x;
+        crop_y = y;
+        crop_width = width;
+        crop_height = height;
+        restart();
+        return true;
+    }
+
+    int frame_width() const { return settings.image_width; }
+    int frame_height() const { return std::max(1, int(settings.image_width / settings.aspect_ratio)); }
+
+    // Throw away the accumulated samples, e.g. after changing settings.
+    void restart()
+    {
+        accum.clear();
+        spp = 0;
+    }
+
+    // Spend about time_budget seconds refining the image. The budget is checked
+    // between one sample per pixel passes, so a pass that is already running
+    // always finishes. Returns false once max_spp is reached.
+    bool refine(double time_budget)
+    {
+        if (spp >= max_spp)
+            return false;
+
+        camera cam = settings;
+        cam.image_width = std::max(1, settings.image_width / scale);
+        cam.samples_per_pixel = max_spp - spp;
+        cam.crop_x = crop_x;
+        cam.crop_y = crop_y;
+        cam.crop_width = crop_width;
+        cam.crop_height = crop_height;
+        cam.show_progress = false;
+        // guiding trains during the first passes of the accumulated image, not of every call
+        cam.guiding_training_passes = std::max(0, settings.guiding_training_passes - spp);
+
+        auto image = cam.render_image(world, time_budget);
+        int passes = cam.rendered_samples_per_pixel();
+        width = cam.rendered_width();
+        height = cam.rendered_height();
+
+        if (accum.size() != image.size())
+            accum.assign(image.size(), color(0, 0, 0));
+        for (size_t i = 0; i < image.size(); i++)
+            accum[i] += passes * image[i];  // image is an average, weight it back to a sum
+        spp += passes;
+        return spp < max_spp;
+    }
+
+    int samples_per_pixel() const { return spp; }
+
+    void write(std::ostream &out) const
+    {
+        out << "P3\n"
+            << width << ' ' << height << "\n255\n";
+        for (const auto &pixel_color : accum)
+            write_color(out, pixel_color / (spp > 0 ? spp : 1));
+    }
+
+    bool write(const std::string &filename) const
+    {
+        std::ofstream out(filename);
+        write(out);
+        return bool(out);
+    }
+
+private:
+    const hittable &world;
+    std::vector<color> accum;
+    int spp = 0;
+    int width = 0;
+    int height = 0;
+
+    int scale = 4;
+    int crop_x = 0;
+    int crop_y = 0;
+    int crop_width = 0;
+    int crop_height = 0;
+};
+
+#endif
@@ -34,6 +34,8 @@ public:
         rec.p = r.at(rec.t);
         vec3 outward_normal = (rec.p - center) / radius; // normalized
         rec.set_face_normal(r, outward_normal);
+        get_sphere_uv(outward_normal, rec.u, rec.v);
+        rec.uv_scale = 1.0 / (2 * pi * radius);
         rec.mat = mat;
 
         return true;
@@ -42,5 +44,16 @@ private:
     point3D center;
     double radius;
     shared_ptr<material> mat;
+
+    static void get_sphere_uv(const point3D& p, double& u, double& v) {
+        // p: a given point on the sphere of radius one, centered at the origin.
+        // u: returned value [0,1] of angle around the Y axis from X=-1.
+        // v: returned value [0,1] of angle from Y=-1 to Y=+1.
+        auto theta = std::acos(-p.y());
+        auto phi = std::atan2(-p.z(), p.x()) + pi;
+
+        u = phi / (2 * pi);
+        v = theta / pi;
+    }
 };
 #endif
\ No newline at end of file
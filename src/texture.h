@@ -0,0 +1,100 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include "raytracer.h"
+#include "texture_cache.h"
+
+class texture
+{
+public:
+    virtual ~texture() = default;
+
+    // uv_width is the approximate size of the pixel footprint in texture space,
+    // 0 means "as sharp as possible". Only filtered textures look at it.
+    virtual color value(double u, double v, const point3D &p, double uv_width) const = 0;
+};
+
+class solid_color : public texture
+{
+public:
+    solid_color(const color &albedo) : albedo(albedo) {}
+
+    solid_color(double red, double green, double blue) : solid_color(color(red, green, blue)) {}
+
+    color value(double u, double v, const point3D &p, double uv_width) const override
+    {
+        return albedo;
+    }
+
+private:
+    color albedo;
+};
+
+// 3D checker pattern, so it works on any surface regardless of its uv mapping.
+class checker_texture : public texture
+{
+public:
+    checker_texture(double scale, shared_ptr<texture> even, shared_ptr<texture> odd)
+        : inv_scale(1.0 / scale), even(even), odd(odd) {}
+
+    checker_texture(double scale, const color &c1, const color &c2)
+        : checker_texture(scale, make_shared<solid_color>(c1), make_shared<solid_color>(c2)) {}
+
+    color value(double u, double v, const point3D &p, double uv_width) const override
+    {
+        auto xInteger = int(std::floor(inv_scale * p.x()));
+        auto yInteger = int(std::floor(inv_scale * p.y()));
+        auto zInteger = int(std::floor(inv_scale * p.z()));
+
+        bool isEven = (xInteger + yInteger + zInteger) % 2 == 0;
+
+        return isEven ? even->value(u, v, p, uv_width) : odd->value(u, v, p, uv_width);
+    }
+
+private:
+    double inv_scale;
+    shared_ptr<texture> even;
+    shared_ptr<texture> odd;
+};
+
+// Image texture streamed through a texture_cache. The mip level is picked from
+// the footprint and the lookup is jittered by up to half a texel, so averaging
+// over the pixel samples gives a bilinear-like result.
+class image_texture : public texture
+{
+public:
+    image_texture(const std::string &filename, shared_ptr<texture_cache> cache)
+        : cache(cache), id(cache->add_image(make_shared<ppm_image_source>(filename))) {}
+
+    color value(double u, double v, const point3D &p, double uv_width) const override
+    {
+        // If we have no texture data, then return solid cyan as a debugging aid.
+        if (id < 0)
+            return color(0, 1, 1);
+
+        u = interval(0, 1).clamp(u);
+        v = 1.0 - interval(0, 1).clamp(v); // Flip V to image coordinates
+
+        int level = 0;
+        int w0 = cache->width(id, 0), h0 = cache->height(id, 0);
+        double texels = uv_width * std::max(w0, h0);
+        if (texels > 1)
+            level = std::min(int(std::log2(texels)), cache->levels(id) - 1);
+
+        int w = cache->width(id, level), h = cache->height(id, level);
+        int x = int(std::floor(u * w + random_double() - 0.5));
+        int y = int(std::floor(v * h + random_double() - 0.5));
+        x = std::max(0, std::min(x, w - 1));
+        y = std::max(0, std::min(y, h - 1));
+
+        auto pixel = cache->texel(id, level, x, y);
+        // stored gamma 2 like write_color() produces, convert back to linear
+        return pixel * pixel;
+    }
+
+private:
+    shared_ptr<texture_cache> cache;
+    int id;
+};
+
+#endif
@@ -0,0 +1,517 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "raytracer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <list>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Read the w*h block at (x0,y0) of a packed 8-bit RGB raster that starts at
+// offset in filename and is row_width texels wide. Every call opens its own
+// stream, so concurrent tile loads never share file state.
+inline bool read_rgb_raster(const std::string &filename, std::streamoff offset, int row_width,
+                            int x0, int y0, int w, int h, unsigned char *out)
+{
+    std::ifstream in(filename, std::ios::binary);
+    if (!in)
+        return false;
+    for (int y = 0; y < h; y++)
+    {
+        std::streamoff row = std::streamoff(y0 + y) * row_width + x0;
+        in.seekg(offset + row * 3);
+        if (!in.read(reinterpret_cast<char *>(out + std::size_t(y) * w * 3), std::streamsize(w) * 3))
+            return false;
+    }
+    return true;
+}
+
+// Texel source for the cache. Implementations must be able to read any
+// rectangle of the full resolution image on demand, so the whole image never
+// has to live in memory at once.
+class image_source
+{
+public:
+    virtual ~image_source() = default;
+
+    virtual bool valid() const = 0;
+    virtual int width() const = 0;
+    virtual int height() const = 0;
+
+    // Read the w*h block at (x0,y0) as packed 8-bit RGB into out (row major).
+    virtual bool read_region(int x0, int y0, int w, int h, unsigned char *out) const = 0;
+
+    // Stable identity of the texel data (path, size, modification time...), used
+    // to keep derived mip levels on disk between runs. Empty means "don't keep".
+    virtual std::string identity() const { return ""; }
+};
+
+// Binary PPM (P6, maxval <= 255), the format this renderer already speaks.
+// Only the header is parsed up front; pixel rows are read by seeking into the
+// file when a tile is requested.
+class ppm_image_source : public image_source
+{
+public:
+    ppm_image_source(const std::string &filename) : filename(filename)
+    {
+        std::ifstream in(filename, std::ios::binary);
+        std::string magic;
+        int maxval = 0;
+        if (!(in >> magic) || magic != "P6" || !read_header_int(in, image_width) ||
+            !read_header_int(in, image_height) || !read_header_int(in, maxval) ||
+            maxval <= 0 || maxval > 255 || image_width <= 0 || image_height <= 0)
+        {
+            std::cerr << "ERROR: Could not load image file '" << filename << "'.\n";
+            image_width = image_height = 0;
+            return;
+        }
+        in.get(); // single whitespace byte between header and raster
+        data_offset = in.tellg();
+    }
+
+    bool valid() const override { return image_width > 0; }
+    int width() const override { return image_width; }
+    int height() const override { return image_height; }
+
+    bool read_region(int x0, int y0, int w, int h, unsigned char *out) const override
+    {
+        return read_rgb_raster(filename, data_offset, image_width, x0, y0, w, h, out);
+    }
+
+    std::string identity() const override
+    {
+        std::error_code ec;
+        auto path = std::filesystem::absolute(filename, ec);
+        auto size = std::filesystem::file_size(filename, ec);
+        auto mtime = std::filesystem::last_write_time(filename, ec);
+        if (ec)
+            return "";
+        return path.string() + '|' + std::to_string(size) + '|' + std::to_string(mtime.time_since_epoch().count());
+    }
+
+private:
+    std::string filename;
+    int image_width = 0;
+    int image_height = 0;
+    std::streamoff data_offset = 0;
+
+    static bool read_header_int(std::istream &in, int &value)
+    {
+        // skip '#' comment lines allowed between header fields
+        in >> std::ws;
+        while (in.peek() == '#')
+        {
+            std::string comment;
+            std::getline(in, comment);
+            in >> std::ws;
+        }
+        return bool(in >> value);
+    }
+};
+
+// Tiled, mipmapped texel cache shared by every image_texture in a scene.
+// Registering an image only reads its header. The first lookup of a coarser
+// mip level streams the source once, row by row, and writes all coarser levels
+// (box filtered, sizes rounded up) to a side file in the temp directory. Side
+// files of sources with an identity() are named after it and kept, so later
+// runs reuse them; the others are removed with the cache. Every tile of every
+// level is then loaded from disk on first access, kept in LRU order and
+// evicted once the resident bytes exceed the memory budget. Tiles are handed
+// out as shared_ptr, so a tile evicted while another thread is still reading
+// it stays alive until that reader is done.
+class texture_cache
+{
+public:
+    struct statistics
+    {
+        std::uint64_t hits;
+        std::uint64_t misses;
+        std::uint64_t evictions;
+        std::size_t resident_bytes;
+        std::size_t resident_tiles;
+        std::size_t memory_budget;
+        std::uint64_t mip_builds;   // pyramids computed from their source this run
+        std::uint64_t mip_reuses;   // pyramids found on disk from an earlier run
+    };
+
+    texture_cache(std::size_t memory_budget = std::size_t(256) << 20, int tile_size = 64)
+        : memory_budget(memory_budget), tile_size(tile_size < 1 ? 1 : tile_size) {}
+
+    ~texture_cache()
+    {
+        for (const auto &img : images)
+        {
+            if (img->keep_mip_file)
+                continue;
+            std::error_code ignored;
+            std::filesystem::remove(img->mip_file, ignored);
+        }
+    }
+
+    // Registers an image and returns its id, or -1 if the source is unusable.
+    // Register images while building the scene, before any render thread samples.
+    int add_image(shared_ptr<image_source> source)
+    {
+        if (!source || !source->valid())
+            return -1;
+
+        std::lock_guard<std::mutex> lock(mtx);
+        if (images.size() >= max_images)
+        {
+            std::cerr << "ERROR: Texture cache is limited to " << max_images << " images.\n";
+            return -1;
+        }
+
+        auto entry = std::make_unique<image_entry>();
+        entry->source = source;
+        int w = source->width(), h = source->height();
+        std::streamoff offset = 0;
+        while (true)
+        {
+            entry->level_width.push_back(w);
+            entry->level_height.push_back(h);
+            entry->level_offset.push_back(offset);
+            if (entry->level_width.size() > 1)
+                offset += std::streamoff(w) * h * 3;
+            if (w == 1 && h == 1)
+                break;
+            w = (w + 1) / 2;
+            h = (h + 1) / 2;
+        }
+        entry->mip_bytes = offset;
+
+        int id = int(images.size());
+        std::string identity = source->identity();
+        entry->keep_mip_file = !identity.empty();
+        std::string name = entry->keep_mip_file
+            ? std::to_string(std::hash<std::string>{}(identity + "|mips v2"))
+            : std::to_string(std::random_device{}()) + "_" + std::to_string(id);
+        entry->mip_file = (std::filesystem::temp_directory_path() / ("rt_mips_" + name + ".rgb")).string();
+
+        images.push_back(std::move(entry));
+        return id;
+    }
+
+    int levels(int id) const { return int(images[id]->level_width.size()); }
+    int width(int id, int level) const { return images[id]->level_width[level]; }
+    int height(int id, int level) const { return images[id]->level_height[level]; }
+
+    // Texel (x,y) of the given mip level as a [0,1] RGB triple (still gamma encoded).
+    // If the coarse levels cannot be built, coarse lookups fall back to level 0.
+    color texel(int id, int level, int x, int y)
+    {
+        if (level > 0 && !ensure_mips(id))
+        {
+            const image_entry &img = *images[id];
+            x = int(std::int64_t(x) * img.level_width[0] / img.level_width[level]);
+            y = int(std::int64_t(y) * img.level_height[0] / img.level_height[level]);
+            level = 0;
+        }
+        auto t = get_tile(id, level, x / tile_size, y / tile_size);
+        const unsigned char *px = t->texel(x % tile_size, y % tile_size);
+        const double scale = 1.0 / 255.0;
+        return color(scale * px[0], scale * px[1], scale * px[2]);
+    }
+
+    void set_memory_budget(std::size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        memory_budget = bytes;
+        evict_to_budget(tile_key(~std::uint64_t(0)));
+    }
+
+    statistics stats() const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return statistics{hits.load(), misses.load(), evictions.load(), resident_bytes, lru.size(), memory_budget,
+                          mip_builds.load(), mip_reuses.load()};
+    }
+
+    void report(std::ostream &out) const
+    {
+        auto s = stats();
+        auto lookups = s.hits + s.misses;
+        out << "Texture cache: " << s.hits << " hits, " << s.misses << " misses";
+        if (lookups > 0)
+            out << " (" << (100.0 * s.hits / lookups) << "% hit rate)";
+        out << ", " << s.evictions << " evictions, " << s.resident_tiles << " tiles / "
+            << (s.resident_bytes >> 10) << " KiB resident of " << (s.memory_budget >> 10) << " KiB budget, "
+            << s.mip_builds << " mip pyramids built, " << s.mip_reuses << " reused\n";
+    }
+
+private:
+    struct tile
+    {
+        int width, height;
+        std::vector<unsigned char> rgb;
+
+        const unsigned char *texel(int x, int y) const { return &rgb[(std::size_t(y) * width + x) * 3]; }
+        std::size_t bytes() const { return rgb.size() + sizeof(tile); }
+    };
+
+    struct image_entry
+    {
+        shared_ptr<image_source> source;
+        std::vector<int> level_width;
+        std::vector<int> level_height;
+        std::vector<std::streamoff> level_offset; // levels >= 1, inside mip_file
+        std::streamoff mip_bytes = 0;
+        std::string mip_file;
+        bool keep_mip_file = false;
+
+        std::once_flag mips_once;
+        bool mips_ok = false;  // written once inside mips_once
+    };
+
+    // one output texel of a box filter: up to three source texels and their coverage
+    struct filter_taps
+    {
+        int first = 0, count = 0;
+        double weight[3] = {0, 0, 0};
+    };
+
+    using tile_key = std::uint64_t;
+    struct lru_entry
+    {
+        tile_key key;
+        shared_ptr<const tile> data;
+    };
+
+    mutable std::mutex mtx;
+    std::vector<std::unique_ptr<image_entry>> images;
+    std::list<lru_entry> lru; // front = most recently used
+    std::unordered_map<tile_key, std::list<lru_entry>::iterator> lookup;
+    std::size_t memory_budget;
+    std::size_t resident_bytes = 0;
+    int tile_size;
+
+    std::atomic<std::uint64_t> hits{0};
+    std::atomic<std::uint64_t> misses{0};
+    std::atomic<std::uint64_t> evictions{0};
+    std::atomic<std::uint64_t> mip_builds{0};
+    std::atomic<std::uint64_t> mip_reuses{0};
+
+    static const std::size_t max_images = std::size_t(1) << 16;
+
+    // 16 bits image id, 8 bits level, 20 bits per tile coordinate
+    static tile_key make_key(int id, int level, int tx, int ty)
+    {
+        return (tile_key(id) << 48) | (tile_key(level) << 40) | (tile_key(tx) << 20) | tile_key(ty);
+    }
+
+    shared_ptr<const tile> get_tile(int id, int level, int tx, int ty)
+    {
+        tile_key key = make_key(id, level, tx, ty);
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            auto it = lookup.find(key);
+            if (it != lookup.end())
+            {
+                hits++;
+                lru.splice(lru.begin(), lru, it->second);
+                return it->second->data;
+            }
+        }
+        misses++;
+
+        // read the tile without holding the lock
+        auto fresh = load_tile(id, level, tx, ty);
+
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = lookup.find(key);
+        if (it != lookup.end()) // another thread won the race, use its copy
+        {
+            lru.splice(lru.begin(), lru, it->second);
+            return it->second->data;
+        }
+        lru.push_front(lru_entry{key, fresh});
+        lookup[key] = lru.begin();
+        resident_bytes += fresh->bytes();
+        evict_to_budget(key);
+        return fresh;
+    }
+
+    // caller holds mtx; never evicts the tile that was just inserted
+    void evict_to_budget(tile_key keep)
+    {
+        while (resident_bytes > memory_budget && !lru.empty() && lru.back().key != keep)
+        {
+            resident_bytes -= lru.back().data->bytes();
+            lookup.erase(lru.back().key);
+            lru.pop_back();
+            evictions++;
+        }
+    }
+
+    shared_ptr<const tile> load_tile(int id, int level, int tx, int ty)
+    {
+        const image_entry &img = *images[id];
+        int x0 = tx * tile_size, y0 = ty * tile_size;
+        auto t = make_shared<tile>();
+        t->width = std::min(tile_size, img.level_width[level] - x0);
+        t->height = std::min(tile_size, img.level_height[level] - y0);
+        t->rgb.assign(std::size_t(t->width) * t->height * 3, 0);
+
+        bool ok = level == 0
+                      ? img.source->read_region(x0, y0, t->width, t->height, t->rgb.data())
+                      : read_rgb_raster(img.mip_file, img.level_offset[level], img.level_width[level],
+                                        x0, y0, t->width, t->height, t->rgb.data());
+        if (!ok)
+            std::cerr << "ERROR: Failed to read texture tile (" << level << ": " << tx << ',' << ty << ").\n";
+        return t;
+    }
+
+    // Makes sure the side file with the coarse levels exists; the first caller
+    // builds it (or finds it from an earlier run), concurrent callers wait.
+    bool ensure_mips(int id)
+    {
+        image_entry &img = *images[id];
+        std::call_once(img.mips_once, [&]
+        {
+            std::error_code ec;
+            if (img.keep_mip_file && std::filesystem::file_size(img.mip_file, ec) == std::uintmax_t(img.mip_bytes) && !ec)
+            {
+                mip_reuses++;
+                img.mips_ok = true;
+                return;
+            }
+
+            // build under a private name and rename, so nobody ever sees a half-written file
+            std::string partial = img.mip_file + ".partial" + std::to_string(std::random_device{}());
+            if (build_mip_file(img, partial))
+            {
+                std::filesystem::rename(partial, img.mip_file, ec);
+                img.mips_ok = !ec;
+            }
+            if (!img.mips_ok)
+            {
+                std::cerr << "ERROR: Could not build mip levels in '" << img.mip_file << "'.\n";
+                std::filesystem::remove(partial, ec);
+                return;
+            }
+            mip_builds++;
+        });
+        return img.mips_ok;
+    }
+
+    // Box filter from n to m texels (m = ceil(n / 2)): output texel x covers
+    // source span [x * n / m, (x + 1) * n / m) and every source texel is
+    // weighted by how much of it lies inside, so odd sizes use three taps and
+    // the level mean is preserved.
+    static std::vector<filter_taps> box_taps(int n, int m)
+    {
+        std::vector<filter_taps> taps(m);
+        double span = double(n) / m;
+        for (int x = 0; x < m; x++)
+        {
+            double a = x * span, b = (x + 1) * span;
+            filter_taps &t = taps[x];
+            t.first = int(std::floor(a));
+            for (int i = t.first; i < n && i < b && t.count < 3; i++)
+            {
+                double overlap = std::min(b, i + 1.0) - std::max(a, double(i));
+                if (overlap > 1e-9)
+                    t.weight[t.count++] = overlap / span;
+                else if (t.count == 0)
+                    t.first++;
+            }
+        }
+        return taps;
+    }
+
+    // One pass over the source rows. Each level filters rows horizontally and
+    // accumulates them into at most two open output rows, so memory stays
+    // O(width) whatever the image size. Values stay in double precision down
+    // the whole chain and are only rounded when written.
+    static bool build_mip_file(const image_entry &img, const std::string &filename)
+    {
+        std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return false;
+
+        struct reducer
+        {
+            std::vector<filter_taps> xtaps, ytaps;
+            std::vector<double> acc[2];  // output rows next_y and next_y + 1
+            int next_y = 0;
+        };
+
+        int levels = int(img.level_width.size());
+        std::vector<reducer> reducers(levels);
+        for (int l = 1; l < levels; l++)
+        {
+            reducers[l].xtaps = box_taps(img.level_width[l - 1], img.level_width[l]);
+            reducers[l].ytaps = box_taps(img.level_height[l - 1], img.level_height[l]);
+            reducers[l].acc[0].assign(std::size_t(img.level_width[l]) * 3, 0.0);
+            reducers[l].acc[1].assign(std::size_t(img.level_width[l]) * 3, 0.0);
+        }
+
+        std::vector<unsigned char> bytes;
+        // feed source row sy of level l - 1 into the reducer producing level l
+        std::function<void(int, int, const std::vector<double> &)> push = [&](int l, int sy, const std::vector<double> &row)
+        {
+            if (l >= levels)
+                return;
+            reducer &r = reducers[l];
+            int w = img.level_width[l];
+
+            for (int k = 0; k < 2 && r.next_y + k < img.level_height[l]; k++)
+            {
+                const filter_taps &ty = r.ytaps[r.next_y + k];
+                int j = sy - ty.first;
+                if (j < 0 || j >= ty.count)
+                    continue;
+                for (int x = 0; x < w; x++)
+                {
+                    const filter_taps &tx = r.xtaps[x];
+                    for (int i = 0; i < tx.count; i++)
+                        for (int c = 0; c < 3; c++)
+                            r.acc[k][x * 3 + c] += ty.weight[j] * tx.weight[i] * row[(tx.first + i) * 3 + c];
+                }
+            }
+
+            const filter_taps &done = r.ytaps[r.next_y];
+            if (sy != done.first + done.count - 1)
+                return;
+
+            // output row next_y is complete
+            std::vector<double> finished;
+            finished.swap(r.acc[0]);
+            r.acc[0].swap(r.acc[1]);
+            r.acc[1].assign(std::size_t(w) * 3, 0.0);
+            int y = r.next_y++;
+
+            bytes.resize(finished.size());
+            for (std::size_t i = 0; i < finished.size(); i++)
+                bytes[i] = (unsigned char)std::min(255.0, std::floor(finished[i] + 0.5));
+            out.seekp(img.level_offset[l] + std::streamoff(y) * w * 3);
+            out.write(reinterpret_cast<const char *>(bytes.data()), std::streamsize(bytes.size()));
+            push(l + 1, y, finished);
+        };
+
+        std::vector<unsigned char> row(std::size_t(img.level_width[0]) * 3);
+        std::vector<double> values(row.size());
+        for (int y = 0; y < img.level_height[0]; y++)
+        {
+            if (!img.source->read_region(0, y, img.level_width[0], 1, row.data()))
+                return false;
+            for (std::size_t i = 0; i < row.size(); i++)
+                values[i] = row[i];
+            push(1, y, values);
+        }
+        out.flush();
+        return bool(out);
+    }
+};
+
+#endif